@@ -114,6 +114,8 @@ namespace Gmic {
     
     public abstract class GmicParameter : Object {
         public string name { get; protected set; }
+        // false for '_' / '~' prefixed parameters, which G'MIC doesn't refresh the preview for
+        public bool refresh_preview { get; set; default = true; }
         private string suffix = "";
         
         public virtual string details() {
@@ -622,9 +624,80 @@ property_double ({{name_normalized}}_y, _("{{name}} Y"), {{default_value_y}})
             }
         }
         
+        // no refresh key at all when every parameter refreshes the preview
+        public bool has_preview_only_parameters {
+            get {
+                foreach (var p in parameters) {
+                    if (!p.refresh_preview) return true;
+                }
+                return false;
+            }
+        }
+        
+        // an empty refresh key when none of them does
+        public bool has_refresh_parameters {
+            get {
+                foreach (var p in parameters) {
+                    if (p.refresh_preview) return true;
+                }
+                return false;
+            }
+        }
+        
+        public string gegl_refresh_parameters_format {
+            owned get {
+                string[] formats = {};
+                foreach (var p in parameters) {
+                    if (p.refresh_preview) formats += p.format();
+                }
+                return string.joinv(",", formats);
+            }
+        }
+        
+        // colors are formatted into temporaries first so they can be freed
+        public string[] gegl_refresh_parameters_setup {
+            owned get {
+                string[] setup = {};
+                foreach (var p in parameters) {
+                    if (p.refresh_preview && p is GmicColorParam) {
+                        setup += "char *%s_rgba = %s;".printf(p.digit_safe_name(), p.wrap_property(p.digit_safe_name()));
+                    }
+                }
+                return setup;
+            }
+        }
+        
+        public string[] gegl_refresh_parameters_cleanup {
+            owned get {
+                string[] cleanup = {};
+                foreach (var p in parameters) {
+                    if (p.refresh_preview && p is GmicColorParam) {
+                        cleanup += "g_free(%s_rgba);".printf(p.digit_safe_name());
+                    }
+                }
+                return cleanup;
+            }
+        }
+        
+        public string gegl_refresh_parameters_args {
+            owned get {
+                string[] args = {};
+                foreach (var p in parameters) {
+                    if (!p.refresh_preview) continue;
+                    if (p is GmicColorParam) {
+                        args += "%s_rgba".printf(p.digit_safe_name());
+                    } else {
+                        args += p.wrap_property(p.digit_safe_name());
+                    }
+                }
+                return string.joinv(",\n      ", args);
+            }
+        }
+        
         private bool collecting_choice = false;
         private string choice_name = "";
         private int choice_default_index = 0;
+        private bool choice_refresh_preview = true;
         private string[] choice_items = {};
         
         public GmicFilter(string name, string command) {
@@ -647,8 +720,10 @@ property_double ({{name_normalized}}_y, _("{{name}} Y"), {{default_value_y}})
             }
             
             string rhs = body.substring(eq + 1).strip();
+            bool refresh_preview = true;
             if (rhs.has_prefix("~") || rhs.has_prefix("_")) {
                 rhs = rhs.substring(1).strip();
+                refresh_preview = false;
             }
         
             if (!rhs.has_prefix("choice(") && !rhs.has_prefix("choice{"))
@@ -682,12 +757,15 @@ property_double ({{name_normalized}}_y, _("{{name}} Y"), {{default_value_y}})
                         opts += t;
                 }
         
-                add_parameter(new GmicChoiceParam(this.command, name, def_index, opts));
+                var choice = new GmicChoiceParam(this.command, name, def_index, opts);
+                choice.refresh_preview = refresh_preview;
+                add_parameter(choice);
                 return true;
             }
         
             collecting_choice = true;
             choice_name = name;
+            choice_refresh_preview = refresh_preview;
             choice_items = {};
         
             string[] first = rhs.split(",");
@@ -730,12 +808,14 @@ property_double ({{name_normalized}}_y, _("{{name}} Y"), {{default_value_y}})
                     choice_default_index,
                     choice_items
                 );
+                p.refresh_preview = choice_refresh_preview;
                 add_parameter(p);
         
                 collecting_choice = false;
                 choice_items = {};
                 choice_name = "";
                 choice_default_index = 0;
+                choice_refresh_preview = true;
         
                 return true;
             }
@@ -758,12 +838,14 @@ property_double ({{name_normalized}}_y, _("{{name}} Y"), {{default_value_y}})
                     choice_default_index,
                     choice_items
                 );
+                p.refresh_preview = choice_refresh_preview;
                 add_parameter(p);
         
                 collecting_choice = false;
                 choice_items = {};
                 choice_name = "";
                 choice_default_index = 0;
+                choice_refresh_preview = true;
         
                 return true;
             }
@@ -965,10 +1047,14 @@ property_double ({{name_normalized}}_y, _("{{name}} Y"), {{default_value_y}})
         
         private GmicParameter? parse_singleline_param(string name, string contents) {
             var rhs = contents;
+            var refresh_preview = true;
         
-            if (rhs.has_prefix("~") || rhs.has_prefix("_"))
+            if (rhs.has_prefix("~") || rhs.has_prefix("_")) {
                 rhs = rhs.substring(1).strip();
+                refresh_preview = false;
+            }
         
+            GmicParameter? param = null;
             try {
                 var regex = new GLib.Regex(
                     "^(float|int|bool|color|text|point)\\s*[\\(\\{](.*)[\\)\\}]$",
@@ -985,23 +1071,31 @@ property_double ({{name_normalized}}_y, _("{{name}} Y"), {{default_value_y}})
         
                 switch (type_name) {
                 case "float":
-                    return new GmicFloatParam.from(name, body);
+                    param = new GmicFloatParam.from(name, body);
+                    break;
                 case "int":
-                    return new GmicIntParam.from(name, body);
+                    param = new GmicIntParam.from(name, body);
+                    break;
                 case "bool":
-                    return new GmicBoolParam.from(name, body);
+                    param = new GmicBoolParam.from(name, body);
+                    break;
                 case "color":
-                    return new GmicColorParam.from(name, body);
+                    param = new GmicColorParam.from(name, body);
+                    break;
                 case "text":
-                    return new GmicTextParam.from(name, body);
+                    param = new GmicTextParam.from(name, body);
+                    break;
                 case "point":
-                    return new GmicPointParam.from(name, body);
+                    param = new GmicPointParam.from(name, body);
+                    break;
                 }
             } catch (Error e) {
                 warning("Regex error: %s", e.message);
             }
         
-            return null;
+            if (param != null)
+                param.refresh_preview = refresh_preview;
+            return param;
         }
         
     }
@@ -86,6 +86,7 @@ process (GeglOperation *operation,
          gint level)
 {
     GeglProperties *props = GEGL_PROPERTIES(operation);
+    gmic_operation_track(operation);
 
     if (!(props->command && props->command[0]))
         return FALSE;
@@ -98,7 +99,8 @@ process (GeglOperation *operation,
         aux_to_use = NULL;
 #endif
 
-    return gmic_process_buffer(
+    char *error_message = NULL;
+    gboolean result = gmic_process_buffer(
         input,
 #ifdef WITH_AUX
         aux_to_use,
@@ -110,8 +112,17 @@ process (GeglOperation *operation,
         props->fit_gmic_output,
         props->merge_layers,
         level,
-        props->command
+        props->command,
+        NULL,
+        gmic_operation_get_history(operation),
+        gmic_operation_get_error_cache(operation),
+        &error_message
     );
+
+    gmic_operation_report_error(operation, error_message);
+    g_free(error_message);
+
+    return result;
 }
 
 static GeglRectangle
@@ -194,6 +205,7 @@ gegl_op_class_init (GeglOpClass *klass)
   operation_class->get_required_for_output = get_required_for_output;
   operation_class->get_cached_region = get_cached_region;
   operation_class->get_bounding_box = get_bounding_box; 
+  gmic_operation_class_install_error_signal(operation_class);
   
   gegl_operation_class_set_keys (operation_class,
     "name",        "gmic:command",
@@ -23,61 +23,716 @@
  #include <babl/babl.h>
  #include <stdio.h>
  #include <stdbool.h>
+ #include <string.h>
+
+ // every plugin module links its own copy of this file, so the pool and its
+ // limit are per module rather than per process
+ #define GMIC_SCRATCH_POOL_SLOTS     4
+ #define GMIC_SCRATCH_POOL_MAX_BYTES (128 * 1024 * 1024)
+ #define GMIC_SCRATCH_MIN_POOLED     (1024 * 1024)
+
+ typedef struct {
+    float *data;
+    gsize  size;
+ } GmicScratchSlot;
+
+ typedef struct {
+    float      *data;
+    gsize       capacity;
+    GeglBuffer *linear_buffer;
+ } GmicPixels;
+
+ static GMutex          scratch_mutex;
+ static GmicScratchSlot scratch_pool[GMIC_SCRATCH_POOL_SLOTS];
+ static gsize           scratch_pool_bytes = 0;
+ static gint            live_operations = 0;
+
+ /* Hands out a scratch block of at least `*size` bytes and stores its actual
+  * capacity back into `*size`, which is what has to be released. Only blocks
+  * of the same size class (up to twice the request) are reused, so a scanline
+  * never takes a full-frame block away from the next input fetch. Small
+  * requests are not pooled at all. */
+ static float *gmic_scratch_acquire(gsize *capacity)
+ {
+    const gsize size = *capacity;
+
+    if (size < GMIC_SCRATCH_MIN_POOLED)
+        return g_malloc(size);
+
+    int best = -1;
+
+    g_mutex_lock(&scratch_mutex);
+    for (int i = 0; i < GMIC_SCRATCH_POOL_SLOTS; i++) {
+        if (!scratch_pool[i].data || scratch_pool[i].size < size || scratch_pool[i].size / 2 > size)
+            continue;
+        if (best < 0 || scratch_pool[i].size < scratch_pool[best].size)
+            best = i;
+    }
+
+    float *data = NULL;
+    if (best >= 0) {
+        data = scratch_pool[best].data;
+        *capacity = scratch_pool[best].size;
+        scratch_pool_bytes -= scratch_pool[best].size;
+        scratch_pool[best].data = NULL;
+        scratch_pool[best].size = 0;
+    }
+    g_mutex_unlock(&scratch_mutex);
+
+    return data ? data : g_malloc(size);
+ }
+
+ /* Returns a scratch block of the given capacity to the pool. The pool never
+  * holds more than GMIC_SCRATCH_POOL_MAX_BYTES; blocks that don't fit are
+  * freed right away. */
+ static void gmic_scratch_release(float *data, gsize size)
+ {
+    if (!data)
+        return;
+
+    if (size < GMIC_SCRATCH_MIN_POOLED || size > GMIC_SCRATCH_POOL_MAX_BYTES) {
+        g_free(data);
+        return;
+    }
+
+    int slot = -1;
+
+    g_mutex_lock(&scratch_mutex);
+    for (int i = 0; i < GMIC_SCRATCH_POOL_SLOTS; i++) {
+        if (!scratch_pool[i].data) {
+            slot = i;
+            break;
+        }
+    }
+
+    if (slot >= 0 && scratch_pool_bytes + size <= GMIC_SCRATCH_POOL_MAX_BYTES) {
+        scratch_pool[slot].data = data;
+        scratch_pool[slot].size = size;
+        scratch_pool_bytes += size;
+        data = NULL;
+    }
+    g_mutex_unlock(&scratch_mutex);
+
+    g_free(data);
+ }
+
+ static void gmic_scratch_trim(void)
+ {
+    g_mutex_lock(&scratch_mutex);
+    for (int i = 0; i < GMIC_SCRATCH_POOL_SLOTS; i++) {
+        g_free(scratch_pool[i].data);
+        scratch_pool[i].data = NULL;
+        scratch_pool[i].size = 0;
+    }
+    scratch_pool_bytes = 0;
+    g_mutex_unlock(&scratch_mutex);
+ }
+
+ static void gmic_operation_untrack(gpointer data)
+ {
+    if (g_atomic_int_dec_and_test(&live_operations))
+        gmic_scratch_trim();
+ }
+
+ void gmic_operation_track(GeglOperation *operation)
+ {
+    if (g_object_get_data(G_OBJECT(operation), GMIC_TRACK_DATA_KEY))
+        return;
+
+    g_atomic_int_inc(&live_operations);
+    g_object_set_data_full(G_OBJECT(operation), GMIC_TRACK_DATA_KEY,
+                           GINT_TO_POINTER(1), gmic_operation_untrack);
+ }
+
+ /* A buffer made of a single tile already in the requested format can be
+  * exposed to G'MIC as is - gegl_buffer_linear_open() then returns the tile
+  * memory instead of allocating and copying. Regular tiled buffers (as handed
+  * over by GIMP or RasterFlow) never qualify, they still go through a copy. */
+ static bool gmic_buffer_is_linear(GeglBuffer *buffer, const Babl *fmt)
+ {
+    const GeglRectangle *ext = gegl_buffer_get_extent(buffer);
+    gint tile_width = 0, tile_height = 0;
+
+    if (gegl_buffer_get_format(buffer) != fmt)
+        return false;
+
+    g_object_get(buffer,
+                 "tile-width",  &tile_width,
+                 "tile-height", &tile_height,
+                 NULL);
+
+    return tile_width == ext->width && tile_height == ext->height;
+ }
+
+ /* Fetches the full extent of `buffer` as interleaved floats. G'MIC is always
+  * run with no_inplace_processing, so the pixels are only read and can come
+  * straight from the buffer's own storage when it is linear. */
+ static GmicPixels gmic_pixels_acquire(GeglBuffer *buffer, const Babl *fmt)
+ {
+    const GeglRectangle *ext = gegl_buffer_get_extent(buffer);
+    const int channels = babl_format_get_n_components(fmt);
+    const gint stride = ext->width * channels * sizeof(float);
+    GmicPixels pixels = { NULL, 0, NULL };
+
+    if (gmic_buffer_is_linear(buffer, fmt)) {
+        gint rowstride = 0;
+        float *data = gegl_buffer_linear_open(buffer, ext, &rowstride, fmt);
+
+        if (data && rowstride == stride) {
+            pixels.data = data;
+            pixels.linear_buffer = buffer;
+            return pixels;
+        }
+        if (data)
+            gegl_buffer_linear_close(buffer, data);
+    }
+
+    pixels.capacity = (gsize) stride * ext->height;
+    pixels.data = gmic_scratch_acquire(&pixels.capacity);
+    gegl_buffer_get(buffer, ext, 1.0f, fmt,
+                    pixels.data, stride,
+                    GEGL_ABYSS_NONE);
+    return pixels;
+ }
+
+ static void gmic_pixels_release(GmicPixels *pixels)
+ {
+    if (pixels->linear_buffer)
+        gegl_buffer_linear_close(pixels->linear_buffer, pixels->data);
+    else
+        gmic_scratch_release(pixels->data, pixels->capacity);
+
+    pixels->data = NULL;
+    pixels->capacity = 0;
+    pixels->linear_buffer = NULL;
+ }
  
- void gmic_render_error(GeglBuffer    *input,
-                        GeglBuffer    *output,
-                        char          *error)
+ #define GMIC_ERROR_CACHE_SIZE 16
+
+ struct _GmicErrorCache {
+    GMutex      mutex;
+    GHashTable *errors;
+    // bumped on every invalidation, errors of an older render aren't stored
+    guint       generation;
+ };
+
+ static void gmic_error_cache_free(gpointer data)
+ {
+    GmicErrorCache *cache = data;
+
+    g_hash_table_destroy(cache->errors);
+    g_mutex_clear(&cache->mutex);
+    g_free(cache);
+ }
+
+ static void gmic_error_cache_clear(GeglNode            *node,
+                                    const GeglRectangle *rect,
+                                    GeglOperation       *operation)
+ {
+    GmicErrorCache *cache = g_object_get_data(G_OBJECT(operation), GMIC_ERROR_CACHE_DATA_KEY);
+    if (!cache)
+        return;
+
+    g_mutex_lock(&cache->mutex);
+    g_hash_table_remove_all(cache->errors);
+    cache->generation++;
+    g_mutex_unlock(&cache->mutex);
+ }
+
+ /* Errors are kept per operation and dropped whenever its node gets
+  * invalidated, i.e. when the input or any property changed - commands can
+  * fail depending on pixel values, so a cached error is only valid for the
+  * very input it was produced with. */
+ GmicErrorCache *gmic_operation_get_error_cache(GeglOperation *operation)
+ {
+    GmicErrorCache *cache = g_object_get_data(G_OBJECT(operation), GMIC_ERROR_CACHE_DATA_KEY);
+
+    if (!cache) {
+        cache = g_new0(GmicErrorCache, 1);
+        g_mutex_init(&cache->mutex);
+        cache->errors = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+        g_object_set_data_full(G_OBJECT(operation), GMIC_ERROR_CACHE_DATA_KEY,
+                               cache, gmic_error_cache_free);
+
+        if (operation->node)
+            g_signal_connect_object(operation->node, "invalidated",
+                                    G_CALLBACK(gmic_error_cache_clear),
+                                    operation, 0);
+    }
+
+    return cache;
+ }
+
+ /* Renders at different mipmap levels see different inputs without any
+  * invalidation in between, so the level and input extents are part of the
+  * key next to the command. */
+ static char *gmic_error_cache_key(const char *command,
+                                   GeglBuffer *input,
+                                   GeglBuffer *aux,
+                                   gint        level)
  {
     const GeglRectangle *ext = gegl_buffer_get_extent(input);
-    const Babl *error_fmt = babl_format("R'G'B'A float");
-
-    GeglNode *graph = gegl_node_new();
-
-    GeglNode *src = gegl_node_new_child(
-        graph,
-        "operation", "gegl:buffer-source",
-        "buffer", input,
-        NULL);
-
-    GeglNode *txt = gegl_node_new_child(
-        graph,
-        "operation", "gegl:text",
-        "string", error,
-        "color", gegl_color_new("red"),
-        "size", 16.0,
-        NULL);
-
-    GeglNode *over = gegl_node_new_child(
-        graph,
-        "operation", "gegl:over",
-        NULL);
-
-    gegl_node_link(src, over);
-    gegl_node_connect(txt, "output", over, "aux");
-
-    float *pixels = g_malloc(ext->width * ext->height * 4 * sizeof(float));
-
-    gegl_node_blit(
-        over,
-        1.0,
-        ext,
-        error_fmt,
-        pixels,
-        GEGL_AUTO_ROWSTRIDE,
-        GEGL_BLIT_DEFAULT);
-
-    gegl_buffer_set(
-        output,
-        ext,
-        0,
-        error_fmt,
-        pixels,
-        GEGL_AUTO_ROWSTRIDE);
-
-    g_free(pixels);
-    g_object_unref(graph);
+    const GeglRectangle *aux_ext = aux ? gegl_buffer_get_extent(aux) : NULL;
+
+    return g_strdup_printf("%d|%d,%d,%dx%d|%d,%d,%dx%d|%s",
+                           level,
+                           ext->x, ext->y, ext->width, ext->height,
+                           aux_ext ? aux_ext->x : 0,
+                           aux_ext ? aux_ext->y : 0,
+                           aux_ext ? aux_ext->width : 0,
+                           aux_ext ? aux_ext->height : 0,
+                           command);
  }
- 
+
+ static guint gmic_error_cache_generation(GmicErrorCache *cache)
+ {
+    guint generation = 0;
+
+    if (!cache)
+        return 0;
+
+    g_mutex_lock(&cache->mutex);
+    generation = cache->generation;
+    g_mutex_unlock(&cache->mutex);
+
+    return generation;
+ }
+
+ static char *gmic_error_cache_lookup(GmicErrorCache *cache, const char *key)
+ {
+    char *error = NULL;
+
+    if (!cache)
+        return NULL;
+
+    g_mutex_lock(&cache->mutex);
+    error = g_strdup(g_hash_table_lookup(cache->errors, key));
+    g_mutex_unlock(&cache->mutex);
+
+    return error;
+ }
+
+ /* Stores the error unless the node got invalidated since `generation` was
+  * read, in which case it belongs to an input that is already gone. */
+ static void gmic_error_cache_store(GmicErrorCache *cache,
+                                    guint           generation,
+                                    const char     *key,
+                                    const char     *error)
+ {
+    if (!cache)
+        return;
+
+    g_mutex_lock(&cache->mutex);
+    if (cache->generation == generation) {
+        if (g_hash_table_size(cache->errors) >= GMIC_ERROR_CACHE_SIZE)
+            g_hash_table_remove_all(cache->errors);
+
+        g_hash_table_replace(cache->errors, g_strdup(key), g_strdup(error));
+    }
+    g_mutex_unlock(&cache->mutex);
+ }
+
+ /* Paints the error message over the input, limited to `roi`. Everything
+  * outside of the text box is a plain buffer copy, only the part of the ROI
+  * covered by the text goes through compositing. */
+ static void gmic_render_error(GeglBuffer    *input,
+                               GeglBuffer    *output,
+                               const GeglRectangle *roi,
+                               const char    *error)
+ {
+    const Babl *error_fmt = babl_format("R'aG'aB'aA float");
+
+    gegl_buffer_copy(input, roi, GEGL_ABYSS_NONE, output, roi);
+
+    GeglColor *color = gegl_color_new("red");
+    GeglNode *txt = gegl_node_new();
+    gegl_node_set(txt,
+                  "operation", "gegl:text",
+                  "string", error,
+                  "color", color,
+                  "size", 16.0,
+                  NULL);
+    g_object_unref(color);
+
+    GeglRectangle text_box = gegl_node_get_bounding_box(txt);
+    GeglRectangle area;
+
+    if (!gegl_rectangle_intersect(&area, &text_box, roi)) {
+        g_object_unref(txt);
+        return;
+    }
+
+    const gsize size = (gsize) area.width * area.height * 4 * sizeof(float);
+    gsize text_capacity = size, pixels_capacity = size;
+    float *text = gmic_scratch_acquire(&text_capacity);
+    float *pixels = gmic_scratch_acquire(&pixels_capacity);
+
+    gegl_node_blit(txt, 1.0, &area, error_fmt, text,
+                   GEGL_AUTO_ROWSTRIDE, GEGL_BLIT_DEFAULT);
+    gegl_buffer_get(output, &area, 1.0, error_fmt, pixels,
+                    GEGL_AUTO_ROWSTRIDE, GEGL_ABYSS_NONE);
+
+    for (int i = 0; i < area.width * area.height * 4; i += 4) {
+        const float keep = 1.0f - text[i+3];
+        pixels[i+0] = text[i+0] + pixels[i+0] * keep;
+        pixels[i+1] = text[i+1] + pixels[i+1] * keep;
+        pixels[i+2] = text[i+2] + pixels[i+2] * keep;
+        pixels[i+3] = text[i+3] + pixels[i+3] * keep;
+    }
+
+    gegl_buffer_set(output, &area, 0, error_fmt, pixels, GEGL_AUTO_ROWSTRIDE);
+
+    gmic_scratch_release(pixels, pixels_capacity);
+    gmic_scratch_release(text, text_capacity);
+    g_object_unref(txt);
+ }
+
+ void gmic_operation_class_install_error_signal(GeglOperationClass *klass)
+ {
+    g_signal_new("gmic-error",
+                 G_TYPE_FROM_CLASS(klass),
+                 G_SIGNAL_RUN_LAST,
+                 0, NULL, NULL, NULL,
+                 G_TYPE_NONE, 1,
+                 G_TYPE_STRING);
+ }
+
+ static GMutex error_report_mutex;
+
+ typedef struct {
+    GeglOperation *operation;
+    char          *error;
+ } GmicErrorReport;
+
+ static gboolean gmic_operation_emit_error(gpointer data)
+ {
+    GmicErrorReport *report = data;
+
+    g_signal_emit_by_name(report->operation, "gmic-error", report->error);
+
+    g_object_unref(report->operation);
+    g_free(report->error);
+    g_free(report);
+    return G_SOURCE_REMOVE;
+ }
+
+ void gmic_operation_report_error(GeglOperation *operation,
+                                  const char    *error)
+ {
+    g_mutex_lock(&error_report_mutex);
+    const char *previous = g_object_get_data(G_OBJECT(operation), GMIC_ERROR_DATA_KEY);
+    const bool changed = g_strcmp0(previous, error) != 0;
+
+    if (changed)
+        g_object_set_data_full(G_OBJECT(operation), GMIC_ERROR_DATA_KEY,
+                               g_strdup(error), g_free);
+    g_mutex_unlock(&error_report_mutex);
+
+    if (!changed || !g_signal_lookup("gmic-error", G_OBJECT_TYPE(operation)))
+        return;
+
+    // process() runs on GEGL's render threads, hosts get the signal on the
+    // default main context instead
+    GmicErrorReport *report = g_new0(GmicErrorReport, 1);
+    report->operation = g_object_ref(operation);
+    report->error = g_strdup(error);
+    g_main_context_invoke(NULL, gmic_operation_emit_error, report);
+ }
+
+ // like the scratch pool, the budget is shared by all operations of one
+ // plugin module, each module has its own
+ #define GMIC_HISTORY_SIZE      4
+ #define GMIC_HISTORY_MAX_BYTES (128 * 1024 * 1024)
+
+ typedef struct {
+    int width;
+    int height;
+    int channels;
+    int aux_width;
+    int aux_height;
+    int aux_channels;
+ } GmicInputShape;
+
+ typedef struct {
+    GmicInputShape shape;
+    guint64        input_hash;
+    char          *command;
+    char          *refresh_key;
+    float         *data;
+    int            width;
+    int            height;
+    int            spectrum;
+ } GmicHistoryEntry;
+
+ struct _GmicHistory {
+    GMutex   mutex;
+    // most recently used first
+    GQueue   entries;
+ };
+
+ // shared by the histories of all operations in this module, GEGL keeps its
+ // own copy of every rendered result on top of that
+ static GMutex history_budget_mutex;
+ static gsize  history_bytes = 0;
+
+ static gsize gmic_history_entry_size(GmicHistoryEntry *entry)
+ {
+    return (gsize) entry->width * entry->height * entry->spectrum * sizeof(float);
+ }
+
+ static void gmic_history_entry_free(GmicHistoryEntry *entry)
+ {
+    g_mutex_lock(&history_budget_mutex);
+    history_bytes -= gmic_history_entry_size(entry);
+    g_mutex_unlock(&history_budget_mutex);
+
+    gmic_delete_external(entry->data);
+    g_free(entry->command);
+    g_free(entry->refresh_key);
+    g_free(entry);
+ }
+
+ static void gmic_history_free(gpointer data)
+ {
+    GmicHistory *history = data;
+
+    g_queue_clear_full(&history->entries, (GDestroyNotify) gmic_history_entry_free);
+    g_mutex_clear(&history->mutex);
+    g_free(history);
+ }
+
+ GmicHistory *gmic_operation_get_history(GeglOperation *operation)
+ {
+    GmicHistory *history = g_object_get_data(G_OBJECT(operation), GMIC_HISTORY_DATA_KEY);
+
+    if (!history) {
+        history = g_new0(GmicHistory, 1);
+        g_mutex_init(&history->mutex);
+        g_queue_init(&history->entries);
+        g_object_set_data_full(G_OBJECT(operation), GMIC_HISTORY_DATA_KEY,
+                               history, gmic_history_free);
+    }
+
+    return history;
+ }
+
+ static bool gmic_input_shape_equal(const GmicInputShape *a, const GmicInputShape *b)
+ {
+    return memcmp(a, b, sizeof(GmicInputShape)) == 0;
+ }
+
+ #define GMIC_HASH_PRIME1 G_GUINT64_CONSTANT(0x9e3779b185ebca87)
+ #define GMIC_HASH_PRIME2 G_GUINT64_CONSTANT(0xc2b2ae3d27d4eb4f)
+ #define GMIC_HASH_PRIME3 G_GUINT64_CONSTANT(0x165667b19e3779f9)
+
+ static inline guint64 gmic_hash_rotl(guint64 x, int r)
+ {
+    return (x << r) | (x >> (64 - r));
+ }
+
+ // xxHash64 round, every input bit reaches every output bit
+ static inline guint64 gmic_hash_round(guint64 acc, guint64 word)
+ {
+    acc += word * GMIC_HASH_PRIME2;
+    acc = gmic_hash_rotl(acc, 31);
+    return acc * GMIC_HASH_PRIME1;
+ }
+
+ /* Fingerprints the input pixels in one pass, xxHash64 style with four
+  * independent lanes over 64 bit words to keep the multiplies from
+  * serializing. */
+ static guint64 gmic_pixels_hash(guint64 hash, const float *data, gsize size)
+ {
+    const guint64 *words = (const guint64 *) data;
+    const gsize count = size / sizeof(guint64);
+    guint64 lanes[4] = {
+        hash + GMIC_HASH_PRIME1 + GMIC_HASH_PRIME2,
+        hash + GMIC_HASH_PRIME2,
+        hash,
+        hash - GMIC_HASH_PRIME1
+    };
+    gsize i = 0;
+
+    for (; i + 4 <= count; i += 4) {
+        lanes[0] = gmic_hash_round(lanes[0], words[i+0]);
+        lanes[1] = gmic_hash_round(lanes[1], words[i+1]);
+        lanes[2] = gmic_hash_round(lanes[2], words[i+2]);
+        lanes[3] = gmic_hash_round(lanes[3], words[i+3]);
+    }
+
+    hash = gmic_hash_rotl(lanes[0], 1) + gmic_hash_rotl(lanes[1], 7) +
+           gmic_hash_rotl(lanes[2], 12) + gmic_hash_rotl(lanes[3], 18);
+    for (int l = 0; l < 4; l++)
+        hash = (hash ^ gmic_hash_round(0, lanes[l])) * GMIC_HASH_PRIME1 + GMIC_HASH_PRIME3;
+
+    hash += size;
+    for (; i < count; i++)
+        hash = gmic_hash_rotl(hash ^ gmic_hash_round(0, words[i]), 27) * GMIC_HASH_PRIME1 + GMIC_HASH_PRIME3;
+
+    const guint8 *tail = (const guint8 *) (words + count);
+    for (gsize j = 0; j < size % sizeof(guint64); j++)
+        hash = gmic_hash_rotl(hash ^ (tail[j] * GMIC_HASH_PRIME3), 11) * GMIC_HASH_PRIME1;
+
+    hash ^= hash >> 33;
+    hash *= GMIC_HASH_PRIME2;
+    hash ^= hash >> 29;
+    hash *= GMIC_HASH_PRIME3;
+    hash ^= hash >> 32;
+
+    return hash;
+ }
+
+ static guint64 gmic_inputs_hash(const GmicInputShape *shape,
+                                 const float *input, gsize input_size,
+                                 const float *aux, gsize aux_size)
+ {
+    guint64 hash = G_GUINT64_CONSTANT(0xcbf29ce484222325);
+
+    hash = gmic_pixels_hash(hash, (const float *) shape, sizeof(GmicInputShape));
+    hash = gmic_pixels_hash(hash, input, input_size);
+    if (aux)
+        hash = gmic_pixels_hash(hash, aux, aux_size);
+
+    return hash;
+ }
+
+ /* Tells whether a lookup could hit at all, so the inputs are only
+  * fingerprinted when a result for this command was kept before. */
+ static bool gmic_history_has_candidate(GmicHistory          *history,
+                                        const GmicInputShape *shape,
+                                        const char           *command,
+                                        const char           *refresh_key)
+ {
+    for (GList *l = history->entries.head; l; l = l->next) {
+        GmicHistoryEntry *entry = l->data;
+
+        if (!gmic_input_shape_equal(&entry->shape, shape))
+            continue;
+        if (g_strcmp0(entry->command, command) == 0)
+            return true;
+        if (refresh_key && g_strcmp0(entry->refresh_key, refresh_key) == 0)
+            return true;
+    }
+
+    return false;
+ }
+
+ /* Finds a previous result for the same inputs and command. When
+  * `refresh_key` is given, a result differing only in parameters G'MIC
+  * marks as not refreshing the preview is good enough too. */
+ static GmicHistoryEntry *gmic_history_lookup(GmicHistory          *history,
+                                              const GmicInputShape *shape,
+                                              guint64               input_hash,
+                                              const char           *command,
+                                              const char           *refresh_key)
+ {
+    GmicHistoryEntry *loose = NULL;
+    GList *loose_link = NULL;
+
+    for (GList *l = history->entries.head; l; l = l->next) {
+        GmicHistoryEntry *entry = l->data;
+
+        if (entry->input_hash != input_hash || !gmic_input_shape_equal(&entry->shape, shape))
+            continue;
+
+        if (g_strcmp0(entry->command, command) == 0) {
+            g_queue_unlink(&history->entries, l);
+            g_queue_push_head_link(&history->entries, l);
+            return entry;
+        }
+
+        if (!loose && refresh_key && g_strcmp0(entry->refresh_key, refresh_key) == 0) {
+            loose = entry;
+            loose_link = l;
+        }
+    }
+
+    if (loose) {
+        g_queue_unlink(&history->entries, loose_link);
+        g_queue_push_head_link(&history->entries, loose_link);
+    }
+
+    return loose;
+ }
+
+ /* Makes room for `size` bytes by dropping this history's oldest results.
+  * Results held by other operations are never touched, when they use up the
+  * shared budget nothing gets stored. */
+ static bool gmic_history_reserve(GmicHistory *history, gsize size)
+ {
+    if (size > GMIC_HISTORY_MAX_BYTES)
+        return false;
+
+    while (history->entries.length >= GMIC_HISTORY_SIZE)
+        gmic_history_entry_free(g_queue_pop_tail(&history->entries));
+
+    for (;;) {
+        g_mutex_lock(&history_budget_mutex);
+        const bool fits = history_bytes + size <= GMIC_HISTORY_MAX_BYTES;
+        if (fits)
+            history_bytes += size;
+        g_mutex_unlock(&history_budget_mutex);
+
+        if (fits)
+            return true;
+        if (g_queue_is_empty(&history->entries))
+            return false;
+
+        gmic_history_entry_free(g_queue_pop_tail(&history->entries));
+    }
+ }
+
+ /* Takes ownership of G'MIC's output, its size must have been reserved. */
+ static GmicHistoryEntry *gmic_history_store(GmicHistory          *history,
+                                             const GmicInputShape *shape,
+                                             guint64               input_hash,
+                                             const char           *command,
+                                             const char           *refresh_key,
+                                             float                *data,
+                                             int                   width,
+                                             int                   height,
+                                             int                   spectrum)
+ {
+    GmicHistoryEntry *entry = g_new0(GmicHistoryEntry, 1);
+    entry->shape       = *shape;
+    entry->input_hash  = input_hash;
+    entry->command     = g_strdup(command);
+    entry->refresh_key = g_strdup(refresh_key);
+    entry->data        = data;
+    entry->width       = width;
+    entry->height      = height;
+    entry->spectrum    = spectrum;
+
+    g_queue_push_head(&history->entries, entry);
+
+    return entry;
+ }
+
+ /* Wraps `body` into the prologue and suffix every G'MIC run gets, used for
+  * the command itself as well as for its refresh key, so the flags are part
+  * of both. */
+ static void gmic_build_command(char       *out,
+                                gsize       size,
+                                const char *body,
+                                bool        fit_gmic_output,
+                                bool        merge_layers)
+ {
+    // inputs are handed over in GEGL's [0,1] range, G'MIC scales its
+    // own copy up to [0,255] before running the actual command
+    const char *merge = merge_layers ? " gui_merge_layers" : "";
+    if (fit_gmic_output) {
+        snprintf(out, size,
+                "mul 255 WH:=w,h %s%s r $WH,1,100%%,2",
+                body,
+                merge);
+    } else {
+        snprintf(out, size,
+                "mul 255 %s%s",
+                body,
+                merge);
+    }
+ }
+
  gboolean gmic_process_buffer(GeglBuffer    *input,
                               GeglBuffer    *aux,
                               GeglBuffer    *output,
@@ -85,8 +740,15 @@
                               bool fit_gmic_output,
                               bool merge_layers,
                               gint level,
-                              char *command)
+                              char *command,
+                              const char *refresh_key,
+                              GmicHistory *history,
+                              GmicErrorCache *errors,
+                              char **error_message)
  {
+    if (error_message)
+        *error_message = NULL;
+
     if (!input) {
         g_warning("GEGL-GMIC: No input buffer provided.");
         return FALSE;
@@ -103,22 +765,44 @@
     } else if (channels == 4) {
         input_fmt = babl_format("R'G'B'A float");
     }
+    channels = babl_format_get_n_components(input_fmt);
     
     GeglRectangle full = *gegl_buffer_get_extent(input);
     const int w = full.width;
     const int h = full.height;
-    const int npix = w * h;
+    const gsize in_size = (gsize) w * h * channels * sizeof(float);
 
-    float *rgba_in = g_malloc(npix * channels * sizeof(float));
-    gegl_buffer_get(input, &full, 1.0f, input_fmt,
-                    rgba_in, w * channels * sizeof(float),
-                    GEGL_ABYSS_NONE);
+    char full_cmd[2048];
+    char *error_key = NULL;
+    const guint error_generation = gmic_error_cache_generation(errors);
 
-    for (int i = 0; i < npix * channels; i++)
-        rgba_in[i] *= 255.0f;
+    if (command && command[0]) {
+        gmic_build_command(full_cmd, sizeof(full_cmd), command,
+                           fit_gmic_output, merge_layers);
+
+        error_key = gmic_error_cache_key(full_cmd, input, aux, level);
+
+        char *cached_error = gmic_error_cache_lookup(errors, error_key);
+        if (cached_error) {
+            gmic_render_error(input, output, roi, cached_error);
+            if (error_message)
+                *error_message = cached_error;
+            else
+                g_free(cached_error);
+            g_free(error_key);
+            return TRUE;
+        }
+    }
+
+    GmicPixels in_pixels = gmic_pixels_acquire(input, input_fmt);
 
-    float *rgba_out = rgba_in;
+    float *rgba_out = in_pixels.data;
     int out_w = w, out_h = h, out_spectrum = channels;
+    float out_scale = 1.0f;
+    GmicHistoryEntry *entry = NULL;
+
+    if (history)
+        g_mutex_lock(&history->mutex);
 
     if (command && command[0]) {
         gmic_interface_image imgs[2];
@@ -127,7 +811,7 @@
         memset(imgs, 0, sizeof(imgs));
 
         strcpy(imgs[0].name, "input");
-        imgs[0].data           = rgba_in;
+        imgs[0].data           = in_pixels.data;
         imgs[0].width          = w;
         imgs[0].height         = h;
         imgs[0].depth          = 1;
@@ -135,7 +819,8 @@
         imgs[0].is_interleaved = true;
         imgs[0].format         = E_FORMAT_FLOAT;
 
-        float *aux_buf = NULL;
+        GmicPixels aux_pixels = { NULL, 0, NULL };
+        gsize aux_size = 0;
 
         if (aux) {
             printf("using aux input...\n");
@@ -150,18 +835,13 @@
             else if (ach == 2) aux_fmt = babl_format("Y'A float");
             else if (ach == 3) aux_fmt = babl_format("R'G'B' float");
             else aux_fmt = babl_format("R'G'B'A float");
+            ach = babl_format_get_n_components(aux_fmt);
 
-            aux_buf = g_malloc(aw * ah * ach * sizeof(float));
-
-            gegl_buffer_get(aux, &aux_ext, 1.0f, aux_fmt,
-                            aux_buf, aw * ach * sizeof(float),
-                            GEGL_ABYSS_NONE);
-
-            for (int i = 0; i < aw * ah * ach; i++)
-                aux_buf[i] *= 255.0f;
+            aux_pixels = gmic_pixels_acquire(aux, aux_fmt);
+            aux_size = (gsize) aw * ah * ach * sizeof(float);
 
             strcpy(imgs[1].name, "aux");
-            imgs[1].data           = aux_buf;
+            imgs[1].data           = aux_pixels.data;
             imgs[1].width          = aw;
             imgs[1].height         = ah;
             imgs[1].depth          = 1;
@@ -172,6 +852,28 @@
             count = 2;
         }
 
+        GmicInputShape shape = {
+            w, h, channels,
+            (int) imgs[1].width, (int) imgs[1].height, (int) imgs[1].spectrum
+        };
+        char loose_key[2048];
+        if (refresh_key)
+            gmic_build_command(loose_key, sizeof(loose_key), refresh_key,
+                               fit_gmic_output, merge_layers);
+        // skipping re-execution for non-refreshing parameters only applies
+        // to downscaled (preview) renders, never to full ones
+        const char *lookup_refresh_key = (refresh_key && level > 0) ? loose_key : NULL;
+        guint64 input_hash = 0;
+        bool hashed = false;
+
+        if (history && gmic_history_has_candidate(history, &shape, full_cmd, lookup_refresh_key)) {
+            input_hash = gmic_inputs_hash(&shape, in_pixels.data, in_size,
+                                          aux_pixels.data, aux_size);
+            hashed = true;
+            entry = gmic_history_lookup(history, &shape, input_hash, full_cmd,
+                                        lookup_refresh_key);
+        }
+
         char error_buffer[4096];
         error_buffer[0] = '\0';
 
@@ -183,44 +885,61 @@
         opt.no_inplace_processing = true;
         opt.error_message_buffer  = error_buffer;
 
-        char full_cmd[2048];
-        const char *merge = merge_layers ? " gui_merge_layers" : "";
-        if (fit_gmic_output) {
-            snprintf(full_cmd, sizeof(full_cmd),
-                    "WH:=w,h %s%s r $WH,1,100%%,2",
-                    command,
-                    merge);
-        } else {
-            snprintf(full_cmd, sizeof(full_cmd),
-                    "%s%s",
-                    command,
-                    merge);
+        if (!entry) {
+            printf("running g'mic command: %s\n", full_cmd);
+            gmic_call(full_cmd, &count, imgs, &opt);
         }
 
+        if (!entry && history && error_buffer[0] == '\0') {
+            const gsize out_size = (gsize) imgs[0].width * imgs[0].height *
+                                   imgs[0].spectrum * sizeof(float);
+
+            if (gmic_history_reserve(history, out_size)) {
+                if (!hashed)
+                    input_hash = gmic_inputs_hash(&shape, in_pixels.data, in_size,
+                                                  aux_pixels.data, aux_size);
+                entry = gmic_history_store(history, &shape, input_hash, full_cmd,
+                                           refresh_key ? loose_key : NULL,
+                                           imgs[0].data, imgs[0].width,
+                                           imgs[0].height, imgs[0].spectrum);
+            }
+        }
 
-        printf("running g'mic command: %s\n", full_cmd);
-        gmic_call(full_cmd, &count, imgs, &opt);
+        if (aux_pixels.data)
+            gmic_pixels_release(&aux_pixels);
 
         if (error_buffer[0] != '\0') {
-            gmic_render_error(input, output, error_buffer);
-            if (aux_buf) g_free(aux_buf);
-            g_free(rgba_in);
+            if (history)
+                g_mutex_unlock(&history->mutex);
+            gmic_pixels_release(&in_pixels);
+            gmic_error_cache_store(errors, error_generation, error_key, error_buffer);
+            gmic_render_error(input, output, roi, error_buffer);
+            if (error_message)
+                *error_message = g_strdup(error_buffer);
+            g_free(error_key);
             return TRUE;
         }
 
-        rgba_out     = imgs[0].data;
-        out_w        = imgs[0].width;
-        out_h        = imgs[0].height;
-        out_spectrum = imgs[0].spectrum;
+        if (entry) {
+            rgba_out     = entry->data;
+            out_w        = entry->width;
+            out_h        = entry->height;
+            out_spectrum = entry->spectrum;
+        } else {
+            rgba_out     = imgs[0].data;
+            out_w        = imgs[0].width;
+            out_h        = imgs[0].height;
+            out_spectrum = imgs[0].spectrum;
+        }
+        out_scale = 1.0f / 255.0f;
         
         GeglRectangle out_ext = {0, 0, out_w, out_h};
         gegl_buffer_set_extent(output, &out_ext);
-
-        if (aux_buf) g_free(aux_buf);
     }
 
-    float *line = g_malloc(roi->width * 4 * sizeof(float));
-    const float inv255 = 1.0f / 255.0f;
+    gsize line_size = (gsize) roi->width * 4 * sizeof(float);
+    float *line = gmic_scratch_acquire(&line_size);
+    const float alpha_max = 1.0f / out_scale;
 
     for (int yy = 0; yy < roi->height; yy++) {
         int sy = roi->y + yy;
@@ -244,12 +963,12 @@
             float r = (out_spectrum > 0) ? p[0] : 0;
             float g = (out_spectrum > 1) ? p[1] : r;
             float b = (out_spectrum > 2) ? p[2] : r;
-            float a = (out_spectrum > 3) ? p[3] : 255.0f;
+            float a = (out_spectrum > 3) ? p[3] : alpha_max;
 
-            line[4*x+0] = r * inv255;
-            line[4*x+1] = g * inv255;
-            line[4*x+2] = b * inv255;
-            line[4*x+3] = a * inv255;
+            line[4*x+0] = r * out_scale;
+            line[4*x+1] = g * out_scale;
+            line[4*x+2] = b * out_scale;
+            line[4*x+3] = a * out_scale;
         }
         
         GeglRectangle scan = { roi->x, sy, roi->width, 1 };
@@ -257,12 +976,16 @@
                         line, roi->width * 4 * sizeof(float));
     }
 
-    g_free(line);
-    g_free(rgba_in);
+    gmic_scratch_release(line, line_size);
 
-    if (rgba_out != rgba_in)
+    if (!entry && rgba_out != in_pixels.data)
         gmic_delete_external(rgba_out);
 
+    if (history)
+        g_mutex_unlock(&history->mutex);
+
+    gmic_pixels_release(&in_pixels);
+    g_free(error_key);
+
     return TRUE;
  }
- 
\ No newline at end of file
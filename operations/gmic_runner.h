@@ -17,8 +17,20 @@
 
 #pragma once
 #include <gegl.h>
+#include <gegl-plugin.h>
 #include <stdbool.h>
 
+#define GMIC_ERROR_DATA_KEY "gmic-error"
+#define GMIC_ERROR_CACHE_DATA_KEY "gmic-error-cache"
+#define GMIC_HISTORY_DATA_KEY "gmic-history"
+#define GMIC_TRACK_DATA_KEY "gmic-track"
+
+// small per-node cache of recent G'MIC results
+typedef struct _GmicHistory GmicHistory;
+
+// per-operation cache of G'MIC errors, cleared on node invalidation
+typedef struct _GmicErrorCache GmicErrorCache;
+
 gboolean gmic_process_buffer(GeglBuffer    *input,
                              GeglBuffer    *aux,
                              GeglBuffer    *output,
@@ -26,4 +38,24 @@ gboolean gmic_process_buffer(GeglBuffer    *input,
                              bool use_input_roi,
                              bool merge_layers,
                              gint level,
-                             char *command);
+                             char *command,
+                             const char *refresh_key,
+                             GmicHistory *history,
+                             GmicErrorCache *errors,
+                             char **error_message);
+
+GmicHistory *gmic_operation_get_history(GeglOperation *operation);
+
+GmicErrorCache *gmic_operation_get_error_cache(GeglOperation *operation);
+
+// keeps count of live operations, shared scratch memory is released once the
+// last one is gone
+void gmic_operation_track(GeglOperation *operation);
+
+// registers the "gmic-error" signal, emitted on the default main context with
+// the error text (or NULL once the error is gone) whenever the operation's
+// G'MIC error changes
+void gmic_operation_class_install_error_signal(GeglOperationClass *klass);
+
+void gmic_operation_report_error(GeglOperation *operation,
+                                 const char    *error);
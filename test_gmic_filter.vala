@@ -0,0 +1,152 @@
+const string STDLIB = """#@gui Test Filter : fx_test, fx_test_preview
+#@gui : Amplitude = _float(10,0,100)
+#@gui : Iterations = ~int(3,1,10)
+#@gui : Radius = float(5,0,10)
+#@gui : Channel = _choice(0,"All","Red")
+#@gui : Blend = ~choice{1,"Normal",
+#@gui : "Multiply",
+#@gui : "Screen"}
+#@gui : Mode = choice{0,"A",
+#@gui : "B"}
+#@gui : Method = choice(0,"X","Y")
+""";
+
+const string MIXED_STDLIB = """#@gui Mixed Filter : fx_mixed, fx_mixed_preview
+#@gui : Color = color(255,0,0)
+#@gui : Center = point(50,50)
+#@gui : Opacity = _float(1,0,1)
+#@gui : Mode = choice(0,"A","B")
+#@gui : Tint = _color(0,0,255)
+#@gui : Shift = ~point(10,10)
+#@gui Preview Only Filter : fx_preview_only, fx_preview_only_preview
+#@gui : Opacity = _float(1,0,1)
+#@gui : Mode = ~choice(0,"A","B")
+#@gui Refreshing Filter : fx_refreshing, fx_refreshing_preview
+#@gui : Radius = float(5,0,10)
+""";
+
+Gmic.GmicFilter find_filter(string command) {
+    var parser = new Gmic.GmicFilterParser();
+    var filters = parser.parse_gmic_stdlib(MIXED_STDLIB);
+
+    foreach (var filter in filters) {
+        if (filter.command == command) {
+            return filter;
+        }
+    }
+    assert_not_reached();
+}
+
+Gmic.GmicParameter? find_parameter(string name) {
+    var parser = new Gmic.GmicFilterParser();
+    var filters = parser.parse_gmic_stdlib(STDLIB);
+    assert_cmpuint(filters.length(), EQ, 1);
+
+    foreach (var param in filters.data.parameters) {
+        if (param.name == name) {
+            return param;
+        }
+    }
+    return null;
+}
+
+void test_prefixed_float() {
+    var param = find_parameter("Amplitude");
+    assert_nonnull(param);
+    assert_false(param.refresh_preview);
+}
+
+void test_prefixed_int() {
+    var param = find_parameter("Iterations");
+    assert_nonnull(param);
+    assert_false(param.refresh_preview);
+}
+
+void test_unprefixed_float() {
+    var param = find_parameter("Radius");
+    assert_nonnull(param);
+    assert_true(param.refresh_preview);
+}
+
+void test_prefixed_inline_choice() {
+    var param = find_parameter("Channel");
+    assert_nonnull(param);
+    assert_false(param.refresh_preview);
+}
+
+void test_prefixed_multiline_choice() {
+    var param = find_parameter("Blend") as Gmic.GmicChoiceParam;
+    assert_nonnull(param);
+    assert_cmpint(param.options.length, EQ, 3);
+    assert_false(param.refresh_preview);
+}
+
+void test_unprefixed_multiline_choice_after_prefixed() {
+    var param = find_parameter("Mode") as Gmic.GmicChoiceParam;
+    assert_nonnull(param);
+    assert_cmpint(param.options.length, EQ, 2);
+    assert_true(param.refresh_preview);
+}
+
+void test_unprefixed_inline_choice() {
+    var param = find_parameter("Method");
+    assert_nonnull(param);
+    assert_true(param.refresh_preview);
+}
+
+void test_refresh_key_mixed() {
+    var filter = find_filter("fx_mixed");
+    assert_true(filter.has_preview_only_parameters);
+    assert_true(filter.has_refresh_parameters);
+
+    assert_cmpstr(filter.gegl_refresh_parameters_format, EQ, "%s,%f,%f,%d");
+    assert_cmpstr(
+        filter.gegl_refresh_parameters_args,
+        EQ,
+        "color_rgba,\n      props->center_x,\nprops->center_y,\n      props->mode"
+    );
+}
+
+void test_refresh_key_color_temporaries() {
+    var filter = find_filter("fx_mixed");
+
+    var setup = filter.gegl_refresh_parameters_setup;
+    assert_cmpint(setup.length, EQ, 1);
+    assert_cmpstr(setup[0], EQ, "char *color_rgba = gegl_color_to_rgba(props->color, false);");
+
+    var cleanup = filter.gegl_refresh_parameters_cleanup;
+    assert_cmpint(cleanup.length, EQ, 1);
+    assert_cmpstr(cleanup[0], EQ, "g_free(color_rgba);");
+}
+
+void test_refresh_key_preview_only() {
+    var filter = find_filter("fx_preview_only");
+    assert_true(filter.has_preview_only_parameters);
+    assert_false(filter.has_refresh_parameters);
+    assert_cmpstr(filter.gegl_refresh_parameters_format, EQ, "");
+}
+
+void test_refresh_key_refreshing_only() {
+    var filter = find_filter("fx_refreshing");
+    assert_false(filter.has_preview_only_parameters);
+    assert_true(filter.has_refresh_parameters);
+}
+
+
+int main(string[] args) {
+    Test.init(ref args);
+
+    Test.add_func("/gmic_filter/prefixed_float", test_prefixed_float);
+    Test.add_func("/gmic_filter/prefixed_int", test_prefixed_int);
+    Test.add_func("/gmic_filter/unprefixed_float", test_unprefixed_float);
+    Test.add_func("/gmic_filter/prefixed_inline_choice", test_prefixed_inline_choice);
+    Test.add_func("/gmic_filter/prefixed_multiline_choice", test_prefixed_multiline_choice);
+    Test.add_func("/gmic_filter/unprefixed_multiline_choice_after_prefixed", test_unprefixed_multiline_choice_after_prefixed);
+    Test.add_func("/gmic_filter/unprefixed_inline_choice", test_unprefixed_inline_choice);
+    Test.add_func("/gmic_filter/refresh_key_mixed", test_refresh_key_mixed);
+    Test.add_func("/gmic_filter/refresh_key_color_temporaries", test_refresh_key_color_temporaries);
+    Test.add_func("/gmic_filter/refresh_key_preview_only", test_refresh_key_preview_only);
+    Test.add_func("/gmic_filter/refresh_key_refreshing_only", test_refresh_key_refreshing_only);
+    
+    return Test.run();
+}